@@ -0,0 +1,40 @@
+CREATE TABLE upd(a int, b int) USING traceam;
+CREATE INDEX upd_a_idx ON upd(a);
+CREATE INDEX upd_b_idx ON upd(b);
+INSERT INTO upd SELECT i, i FROM generate_series(1, 10) i;
+
+-- Updates that only change b are not HOT, so each of them adds an
+-- entry to both indexes. Since a is not changed, the btree deletes the
+-- entries for dead row versions from upd_a_idx bottom-up, asking the
+-- table access method which of them can go, instead of splitting the
+-- page.
+SELECT traceam_callback_memory_reset();
+SET traceam.track_memory TO on;
+DO $$
+BEGIN
+  FOR i IN 1..1000 LOOP
+    UPDATE upd SET b = b + 10;
+    COMMIT;
+  END LOOP;
+END
+$$;
+RESET traceam.track_memory;
+
+SELECT calls > 0 AS called FROM traceam.callback_memory
+ WHERE callback = 'index_delete_tuples';
+
+-- The number of pages needed for upd_a_idx stays flat, while upd_b_idx
+-- gets a new key for each row version and keeps growing.
+SELECT pg_relation_size('upd_a_idx') / current_setting('block_size')::int <= 4
+       AS a_flat,
+       pg_relation_size('upd_b_idx') / current_setting('block_size')::int > 4
+       AS b_grows;
+
+-- Index scans do not return tuples from traced tables.
+SET enable_indexscan TO off;
+SET enable_bitmapscan TO off;
+SELECT a, b FROM upd ORDER BY a;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+
+DROP TABLE upd;
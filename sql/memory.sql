@@ -0,0 +1,15 @@
+CREATE TABLE mem(a int) USING traceam;
+INSERT INTO mem SELECT generate_series(1, 10);
+
+SELECT traceam_callback_memory_reset();
+SET traceam.track_memory TO on;
+SELECT count(*) FROM mem;
+RESET traceam.track_memory;
+
+-- Byte counts vary between runs, but the calls made do not.
+SELECT callback, calls FROM traceam.callback_memory ORDER BY 1;
+
+SELECT traceam_callback_memory_reset();
+SELECT count(*) FROM traceam.callback_memory;
+
+DROP TABLE mem;
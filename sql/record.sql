@@ -0,0 +1,50 @@
+-- The recording is written to the data directory and left there on
+-- purpose, so that it can be inspected after a failed run. It is
+-- truncated first so that it does not grow with each run.
+DO $$
+BEGIN
+  EXECUTE format('COPY (SELECT WHERE false) TO %L',
+                 current_setting('data_directory') || '/traceam_record.rec');
+END
+$$;
+
+CREATE TABLE rec_src(a int, b text) USING traceam;
+CREATE TABLE rec_dst(a int, b text) USING heap;
+
+-- Recordings are appended to the file, so each replay below only
+-- replays the calls for one table.
+SET traceam.record_file TO 'traceam_record.rec';
+INSERT INTO rec_src VALUES (1, 'one'), (2, 'two'), (3, 'three');
+UPDATE rec_src SET b = 'TWO' WHERE a = 2;
+DELETE FROM rec_src WHERE a = 3;
+RESET traceam.record_file;
+
+-- 3 inserts, the update with its scan (8 calls), and the delete with
+-- its scan (7 calls).
+SELECT traceam_replay('traceam_record.rec', 'rec_dst', 'rec_src');
+SELECT * FROM rec_src ORDER BY a;
+SELECT * FROM rec_dst ORDER BY a;
+
+-- Indexes would not be maintained, so they are rejected.
+CREATE TABLE rec_idx(a int, b text) USING heap;
+CREATE INDEX rec_idx_a_idx ON rec_idx(a);
+SELECT traceam_replay('traceam_record.rec', 'rec_idx', 'rec_src');
+
+-- Recorded values have to match the types of the target columns.
+CREATE TABLE rec_text(a text, b text) USING heap;
+SELECT traceam_replay('traceam_record.rec', 'rec_text', 'rec_src');
+
+-- Recorded TIDs that do not refer to a tuple in the target are not
+-- passed on to the table access method: the delete below is recorded
+-- against a populated table and replayed into a table with fewer rows.
+CREATE TABLE rec_del(a int) USING traceam;
+INSERT INTO rec_del VALUES (1), (2), (3);
+SET traceam.record_file TO 'traceam_record.rec';
+DELETE FROM rec_del WHERE a = 3;
+RESET traceam.record_file;
+CREATE TABLE rec_few(a int) USING heap;
+INSERT INTO rec_few VALUES (1);
+SELECT traceam_replay('traceam_record.rec', 'rec_few', 'rec_del');
+SELECT * FROM rec_few;
+
+DROP TABLE rec_src, rec_dst, rec_idx, rec_text, rec_del, rec_few;
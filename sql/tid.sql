@@ -0,0 +1,31 @@
+CREATE TABLE tids(a int) USING traceam;
+INSERT INTO tids SELECT generate_series(1, 10);
+
+-- Prefer the TID-based access paths whenever they are applicable.
+SET enable_seqscan TO off;
+
+EXPLAIN (COSTS OFF) SELECT ctid, a FROM tids WHERE ctid = '(0,3)';
+SELECT ctid, a FROM tids WHERE ctid = '(0,3)';
+SELECT ctid, a FROM tids WHERE ctid = ANY (ARRAY['(0,2)', '(0,9)']::tid[]);
+EXPLAIN (COSTS OFF)
+SELECT ctid, a FROM tids WHERE ctid >= '(0,4)' AND ctid < '(0,7)';
+SELECT ctid, a FROM tids WHERE ctid >= '(0,4)' AND ctid < '(0,7)';
+SELECT ctid, a FROM tids WHERE ctid >= '(1,0)';
+
+RESET enable_seqscan;
+
+START TRANSACTION;
+DECLARE c CURSOR FOR SELECT a FROM tids WHERE a = 5;
+FETCH c;
+UPDATE tids SET a = 50 WHERE CURRENT OF c;
+COMMIT;
+SELECT a FROM tids ORDER BY a;
+
+-- Inserted rows report the traced table rather than the inner heap,
+-- also when inserted speculatively.
+INSERT INTO tids VALUES (11) RETURNING tableoid::regclass, a;
+CREATE UNIQUE INDEX tids_a_key ON tids(a);
+INSERT INTO tids VALUES (12) ON CONFLICT (a) DO NOTHING
+RETURNING tableoid::regclass, a;
+
+DROP TABLE tids;
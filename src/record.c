@@ -0,0 +1,724 @@
+#include "record.h"
+
+#include <postgres.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <access/detoast.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/objectaddress.h>
+#include <catalog/pg_authid.h>
+#include <executor/tuptable.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <storage/fd.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/guc.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/relcache.h>
+#include <utils/snapmgr.h>
+
+#include "traceam.h"
+
+PG_FUNCTION_INFO_V1(traceam_replay);
+
+typedef struct TraceRecordHeader {
+  uint32 length; /* total length of record, including header */
+  uint8 kind;    /* TraceRecordKind */
+  uint8 snapshot_type; /* SnapshotType, MVCC if the call has none */
+  int32 pid;     /* backend that made the call */
+  Oid relid;     /* traced relation */
+  uint32 scanid; /* backend-local scan number, for scan records */
+  TransactionId xid; /* top-level transaction, if it has one */
+  CommandId cid;
+  ItemPointerData tid;
+  int32 arg; /* kind-specific: flags, direction, lock mode, or options */
+} TraceRecordHeader;
+
+/* Scans being replayed are identified by backend and scan number */
+typedef struct ReplayScanKey {
+  int32 pid;
+  uint32 scanid;
+} ReplayScanKey;
+
+typedef struct ReplayScanEntry {
+  ReplayScanKey key;
+  TableScanDesc scan;
+  SnapshotData snapshot; /* used by the scan unless MVCC or built-in */
+} ReplayScanEntry;
+
+char *trace_record_file = NULL;
+
+static int record_fd = -1;
+static uint32 next_scanid = 1;
+static MemoryContext record_context = NULL;
+
+/* A changed record file is opened on the next write */
+static void assign_record_file(const char *newval, void *extra) {
+  if (record_fd >= 0) {
+    close(record_fd);
+    record_fd = -1;
+  }
+}
+
+static void record_begin(StringInfo buf, TraceRecordKind kind,
+                         Relation relation, uint32 scanid, CommandId cid,
+                         Snapshot snapshot, ItemPointer tid, int32 arg) {
+  TraceRecordHeader header;
+  MemoryContext oldcxt;
+
+  /* Also releases memory from a previous record that failed to write */
+  if (record_context == NULL)
+    record_context = AllocSetContextCreate(
+        TopMemoryContext, "traceam record", ALLOCSET_SMALL_SIZES);
+  else
+    MemoryContextReset(record_context);
+
+  memset(&header, 0, sizeof(header));
+  header.kind = kind;
+  header.snapshot_type = snapshot ? snapshot->snapshot_type : SNAPSHOT_MVCC;
+  header.pid = MyProcPid;
+  header.relid = RelationGetRelid(relation);
+  header.scanid = scanid;
+  header.xid = GetTopTransactionIdIfAny();
+  header.cid = cid;
+  if (tid)
+    ItemPointerCopy(tid, &header.tid);
+  else
+    ItemPointerSetInvalid(&header.tid);
+  header.arg = arg;
+
+  oldcxt = MemoryContextSwitchTo(record_context);
+  initStringInfo(buf);
+  MemoryContextSwitchTo(oldcxt);
+  appendBinaryStringInfo(buf, (char *)&header, sizeof(header));
+}
+
+/* Append the slot contents: the number of attributes, the type of each
+ * attribute, and the values using the datum serialization format. The
+ * types are needed to check that the target relation can store the
+ * values. Values that are stored externally are detoasted since the
+ * pointers are not valid in the target relation. */
+static void record_append_slot(StringInfo buf, TupleTableSlot *slot) {
+  TupleDesc desc = slot->tts_tupleDescriptor;
+  int16 natts = desc->natts;
+  MemoryContext oldcxt = MemoryContextSwitchTo(record_context);
+
+  slot_getallattrs(slot);
+  appendBinaryStringInfo(buf, (char *)&natts, sizeof(natts));
+  for (int i = 0; i < natts; i++) {
+    Oid typid = TupleDescAttr(desc, i)->atttypid;
+    appendBinaryStringInfo(buf, (char *)&typid, sizeof(typid));
+  }
+  for (int i = 0; i < natts; i++) {
+    Form_pg_attribute attr = TupleDescAttr(desc, i);
+    Datum value = slot->tts_values[i];
+    bool isnull = slot->tts_isnull[i];
+    Size size;
+    char *ptr;
+
+    if (!isnull && attr->attlen == -1 &&
+        VARATT_IS_EXTERNAL(DatumGetPointer(value)))
+      value = PointerGetDatum(
+          detoast_external_attr((struct varlena *)DatumGetPointer(value)));
+
+    size = datumEstimateSpace(value, isnull, attr->attbyval, attr->attlen);
+    enlargeStringInfo(buf, size);
+    ptr = buf->data + buf->len;
+    datumSerialize(value, isnull, attr->attbyval, attr->attlen, &ptr);
+    buf->len += size;
+    buf->data[buf->len] = '\0';
+  }
+  MemoryContextSwitchTo(oldcxt);
+}
+
+/* Each record is written using a single append, so records from
+ * different backends recording to the same file are not interleaved. */
+static void record_write(StringInfo buf) {
+  if (record_fd < 0) {
+    record_fd = BasicOpenFile(trace_record_file,
+                              O_WRONLY | O_APPEND | O_CREAT | PG_BINARY);
+    if (record_fd < 0)
+      ereport(ERROR,
+              (errcode_for_file_access(),
+               errmsg("could not open record file \"%s\": %m",
+                      trace_record_file)));
+  }
+
+  ((TraceRecordHeader *)buf->data)->length = buf->len;
+
+  errno = 0;
+  if (write(record_fd, buf->data, buf->len) != buf->len) {
+    /* if write didn't set errno, assume problem is no disk space */
+    if (errno == 0)
+      errno = ENOSPC;
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not write to record file \"%s\": %m",
+                    trace_record_file)));
+  }
+}
+
+void trace_record_scan(TraceRecordKind kind, TableScanDesc scan, int32 arg) {
+  TraceScanDesc tscan = (TraceScanDesc)scan;
+  StringInfoData buf;
+
+  Snapshot snapshot = NULL;
+
+  /* Only the start of the scan uses the snapshot */
+  if (kind == TRACE_RECORD_SCAN_BEGIN) {
+    tscan->record_scanid = next_scanid++;
+    snapshot = scan->rs_snapshot;
+  }
+
+  record_begin(&buf, kind, scan->rs_rd, tscan->record_scanid,
+               InvalidCommandId, snapshot, NULL, arg);
+  record_write(&buf);
+}
+
+/* The minimum TID is stored in the header and the maximum TID is the
+ * payload. */
+void trace_record_scan_tidrange(TableScanDesc scan, ItemPointer mintid,
+                                ItemPointer maxtid) {
+  TraceScanDesc tscan = (TraceScanDesc)scan;
+  StringInfoData buf;
+
+  record_begin(&buf, TRACE_RECORD_SCAN_SET_TIDRANGE, scan->rs_rd,
+               tscan->record_scanid, InvalidCommandId, NULL, mintid, 0);
+  appendBinaryStringInfo(&buf, (char *)maxtid, sizeof(ItemPointerData));
+  record_write(&buf);
+}
+
+void trace_record_tuple(TraceRecordKind kind, Relation relation,
+                        ItemPointer tid, CommandId cid, Snapshot snapshot,
+                        int32 arg, TupleTableSlot *slot) {
+  StringInfoData buf;
+
+  record_begin(&buf, kind, relation, 0, cid, snapshot, tid, arg);
+  if (slot)
+    record_append_slot(&buf, slot);
+  record_write(&buf);
+}
+
+/* The number of tuples precedes the tuples in the payload */
+void trace_record_multi_insert(Relation relation, TupleTableSlot **slots,
+                               int ntuples, CommandId cid, int options) {
+  StringInfoData buf;
+  int32 count = ntuples;
+
+  record_begin(&buf, TRACE_RECORD_MULTI_INSERT, relation, 0, cid, NULL,
+               NULL, options);
+  appendBinaryStringInfo(&buf, (char *)&count, sizeof(count));
+  for (int i = 0; i < ntuples; i++)
+    record_append_slot(&buf, slots[i]);
+  record_write(&buf);
+}
+
+/**
+ * Read the next record from the file.
+ *
+ * @returns false on end of file.
+ */
+static bool read_record(FILE *file, const char *path,
+                        TraceRecordHeader *header, StringInfo payload) {
+  size_t nread = fread(header, 1, sizeof(*header), file);
+  size_t length;
+
+  if (nread == 0 && !ferror(file))
+    return false;
+
+  if (ferror(file))
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not read record file \"%s\": %m", path)));
+
+  if (nread != sizeof(*header) || header->length < sizeof(*header))
+    ereport(ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED),
+             errmsg("invalid record in record file \"%s\"", path)));
+
+  length = header->length - sizeof(*header);
+  resetStringInfo(payload);
+  enlargeStringInfo(payload, length);
+  if (fread(payload->data, 1, length, file) != length)
+    ereport(ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED),
+             errmsg("truncated record in record file \"%s\"", path)));
+  payload->len = length;
+  payload->data[length] = '\0';
+  return true;
+}
+
+static void payload_corrupted(void) pg_attribute_noreturn();
+
+static void payload_corrupted(void) {
+  ereport(ERROR,
+          (errcode(ERRCODE_DATA_CORRUPTED),
+           errmsg("invalid record payload")));
+}
+
+/* Read the next size bytes of the payload, which ends at end */
+static void payload_read(void *dest, char **ptr, const char *end, Size size) {
+  if ((Size)(end - *ptr) < size)
+    payload_corrupted();
+  memcpy(dest, *ptr, size);
+  *ptr += size;
+}
+
+/* Check that the next datum of the payload, as written by
+ * datumSerialize(), ends before end, since datumRestore() cannot. */
+static void payload_check_datum(char *ptr, const char *end) {
+  int header;
+  Size size;
+
+  payload_read(&header, &ptr, end, sizeof(header));
+  if (header == -2)
+    size = 0; /* null */
+  else if (header == -1)
+    size = sizeof(Datum); /* pass by value */
+  else if (header >= 0)
+    size = header;
+  else
+    payload_corrupted();
+  if ((Size)(end - ptr) < size)
+    payload_corrupted();
+}
+
+/* Restore the next tuple in the payload into a virtual slot */
+static void restore_slot(TupleTableSlot *slot, char **ptr, const char *end) {
+  TupleDesc desc = slot->tts_tupleDescriptor;
+  int16 natts;
+
+  payload_read(&natts, ptr, end, sizeof(natts));
+
+  if (natts != desc->natts)
+    ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+             errmsg("recorded tuple has %d attributes but target relation "
+                    "has %d",
+                    natts,
+                    desc->natts)));
+
+  for (int i = 0; i < natts; i++) {
+    Form_pg_attribute attr = TupleDescAttr(desc, i);
+    Oid typid;
+
+    payload_read(&typid, ptr, end, sizeof(typid));
+    if (typid != attr->atttypid)
+      ereport(ERROR,
+              (errcode(ERRCODE_DATATYPE_MISMATCH),
+               errmsg("recorded value for column \"%s\" has type %s but "
+                      "the column has type %s",
+                      NameStr(attr->attname),
+                      format_type_be(typid),
+                      format_type_be(attr->atttypid))));
+  }
+
+  ExecClearTuple(slot);
+  for (int i = 0; i < natts; i++) {
+    payload_check_datum(*ptr, end);
+    slot->tts_values[i] = datumRestore(ptr, &slot->tts_isnull[i]);
+  }
+  ExecStoreVirtualTuple(slot);
+}
+
+static bool record_has_cid(TraceRecordKind kind) {
+  switch (kind) {
+    case TRACE_RECORD_TUPLE_INSERT:
+    case TRACE_RECORD_MULTI_INSERT:
+    case TRACE_RECORD_TUPLE_DELETE:
+    case TRACE_RECORD_TUPLE_UPDATE:
+    case TRACE_RECORD_TUPLE_LOCK:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static TableScanDesc replay_find_scan(HTAB *scans, TraceRecordHeader *header,
+                                      bool remove) {
+  ReplayScanKey key;
+  ReplayScanEntry *entry;
+
+  memset(&key, 0, sizeof(key));
+  key.pid = header->pid;
+  key.scanid = header->scanid;
+  entry = hash_search(scans, &key, remove ? HASH_REMOVE : HASH_FIND, NULL);
+  return entry ? entry->scan : NULL;
+}
+
+/* Calls made with one of the built-in snapshots are replayed with the
+ * same kind of snapshot, using data for the kinds that need it, and
+ * other calls with the snapshot of the replaying transaction. */
+static Snapshot replay_snapshot(Relation target, TraceRecordHeader *header,
+                                SnapshotData *data) {
+  switch ((SnapshotType)header->snapshot_type) {
+    case SNAPSHOT_ANY:
+      return SnapshotAny;
+    case SNAPSHOT_SELF:
+      return SnapshotSelf;
+    case SNAPSHOT_DIRTY:
+      InitDirtySnapshot(*data);
+      return data;
+    case SNAPSHOT_NON_VACUUMABLE:
+      InitNonVacuumableSnapshot(*data, GlobalVisTestFor(target));
+      return data;
+    default:
+      return GetActiveSnapshot();
+  }
+}
+
+/* Frozen tuples stay visible if the replay is rolled back, so inserts
+ * are only replayed as frozen if the target was created or truncated in
+ * the current subtransaction, like for COPY FREEZE. */
+static int replay_insert_options(Relation target, int32 options) {
+  if (target->rd_createSubid == InvalidSubTransactionId &&
+      target->rd_newRelfilelocatorSubid == InvalidSubTransactionId)
+    options &= ~TABLE_INSERT_FROZEN;
+  return options;
+}
+
+/* The table access method callbacks trust the TIDs they are given, so
+ * a recorded TID is only passed on if it refers to a tuple in the
+ * target, regardless of its visibility. The TID scan is restarted to
+ * see blocks added by the replay. */
+static bool replay_tid_valid(Relation target, TableScanDesc tidscan,
+                             ItemPointer tid, TupleTableSlot *slot) {
+  table_rescan(tidscan, NULL);
+  return table_tuple_tid_valid(tidscan, tid) &&
+         table_tuple_fetch_row_version(target, tid, SnapshotAny, slot);
+}
+
+/**
+ * Replay a single record against the target relation.
+ *
+ * Scans are started in scancxt so that they survive the per-record
+ * memory context. Scan records for scans that were started before the
+ * recording started are ignored.
+ *
+ * @returns false if the record was skipped since its TID does not refer
+ * to a tuple in the target.
+ */
+static bool replay_record(Relation target, TraceRecordHeader *header,
+                          StringInfo payload, HTAB *scans,
+                          MemoryContext scancxt, TableScanDesc tidscan,
+                          TupleTableSlot *slot,
+                          TupleTableSlot *values_slot) {
+  SnapshotData snapshot_data;
+  Snapshot snapshot = replay_snapshot(target, header, &snapshot_data);
+  CommandId cid = GetCurrentCommandId(true);
+  char *ptr = payload->data;
+  const char *end = payload->data + payload->len;
+  TableScanDesc scan;
+  TM_FailureData tmfd;
+
+  switch ((TraceRecordKind)header->kind) {
+    case TRACE_RECORD_SCAN_BEGIN: {
+      ReplayScanKey key;
+      ReplayScanEntry *entry;
+      bool found;
+      MemoryContext oldcxt;
+
+      memset(&key, 0, sizeof(key));
+      key.pid = header->pid;
+      key.scanid = header->scanid;
+      entry = hash_search(scans, &key, HASH_ENTER, &found);
+      if (found)
+        table_endscan(entry->scan);
+
+      /* The snapshot belongs to us, so the scan must not unregister it,
+       * and snapshot data needs to live as long as the scan */
+      snapshot = replay_snapshot(target, header, &entry->snapshot);
+      oldcxt = MemoryContextSwitchTo(scancxt);
+      entry->scan = target->rd_tableam->scan_begin(
+          target, snapshot, 0, NULL, NULL,
+          (uint32)header->arg & ~SO_TEMP_SNAPSHOT);
+      MemoryContextSwitchTo(oldcxt);
+      break;
+    }
+
+    case TRACE_RECORD_SCAN_RESCAN:
+      if ((scan = replay_find_scan(scans, header, false)))
+        table_rescan(scan, NULL);
+      break;
+
+    case TRACE_RECORD_SCAN_GETNEXTSLOT:
+      if ((scan = replay_find_scan(scans, header, false)))
+        table_scan_getnextslot(scan, (ScanDirection)header->arg, slot);
+      break;
+
+    case TRACE_RECORD_SCAN_SET_TIDRANGE: {
+      ItemPointerData maxtid;
+
+      payload_read(&maxtid, &ptr, end, sizeof(maxtid));
+      if ((scan = replay_find_scan(scans, header, false)))
+        table_set_tidrange(scan, &header->tid, &maxtid);
+      break;
+    }
+
+    case TRACE_RECORD_SCAN_GETNEXTSLOT_TIDRANGE:
+      if ((scan = replay_find_scan(scans, header, false)))
+        table_scan_getnextslot_tidrange(scan, (ScanDirection)header->arg,
+                                        slot);
+      break;
+
+    case TRACE_RECORD_SCAN_END:
+      if ((scan = replay_find_scan(scans, header, true)))
+        table_endscan(scan);
+      break;
+
+    case TRACE_RECORD_FETCH_ROW_VERSION:
+      if (!replay_tid_valid(target, tidscan, &header->tid, slot))
+        return false;
+      table_tuple_fetch_row_version(target, &header->tid, snapshot, slot);
+      break;
+
+    case TRACE_RECORD_TUPLE_INSERT:
+      restore_slot(values_slot, &ptr, end);
+      table_tuple_insert(target, values_slot, cid,
+                         replay_insert_options(target, header->arg), NULL);
+      break;
+
+    case TRACE_RECORD_MULTI_INSERT: {
+      TupleTableSlot **slots;
+      int32 ntuples;
+
+      /* Each tuple takes at least the space of its attribute count */
+      payload_read(&ntuples, &ptr, end, sizeof(ntuples));
+      if (ntuples < 0 || (Size)ntuples > (Size)(end - ptr) / sizeof(int16))
+        payload_corrupted();
+      slots = palloc(ntuples * sizeof(TupleTableSlot *));
+      for (int i = 0; i < ntuples; i++) {
+        slots[i] = MakeSingleTupleTableSlot(RelationGetDescr(target),
+                                            &TTSOpsVirtual);
+        restore_slot(slots[i], &ptr, end);
+      }
+      table_multi_insert(target, slots, ntuples, cid,
+                         replay_insert_options(target, header->arg), NULL);
+      for (int i = 0; i < ntuples; i++)
+        ExecDropSingleTupleTableSlot(slots[i]);
+      break;
+    }
+
+    case TRACE_RECORD_TUPLE_DELETE:
+      if (!replay_tid_valid(target, tidscan, &header->tid, slot))
+        return false;
+      table_tuple_delete(target, &header->tid, cid, snapshot, InvalidSnapshot,
+                         true, &tmfd, false);
+      break;
+
+    case TRACE_RECORD_TUPLE_UPDATE: {
+      LockTupleMode lockmode;
+#if PG_MAJORVERSION_NUM >= 16
+      TU_UpdateIndexes update_indexes;
+#else
+      bool update_indexes;
+#endif
+
+      if (!replay_tid_valid(target, tidscan, &header->tid, slot))
+        return false;
+      restore_slot(values_slot, &ptr, end);
+      table_tuple_update(target, &header->tid, values_slot, cid, snapshot,
+                         InvalidSnapshot, true, &tmfd, &lockmode,
+                         &update_indexes);
+      break;
+    }
+
+    case TRACE_RECORD_TUPLE_LOCK:
+      if (!replay_tid_valid(target, tidscan, &header->tid, slot))
+        return false;
+      table_tuple_lock(target, &header->tid, snapshot, slot, cid,
+                       (LockTupleMode)(header->arg & 0xff),
+                       (LockWaitPolicy)((header->arg >> 8) & 0xff),
+                       (uint8)((header->arg >> 16) & 0xff), &tmfd);
+      break;
+
+    default:
+      ereport(ERROR,
+              (errcode(ERRCODE_DATA_CORRUPTED),
+               errmsg("invalid record kind %d", header->kind)));
+  }
+  return true;
+}
+
+/**
+ * Replay a recorded call stream against a relation.
+ *
+ * Calls are replayed in the order they were recorded, as fast as
+ * possible, inside the calling transaction. A change of transaction or
+ * command id in the recording results in a command counter increment.
+ * The target relation can use any table access method, but has to have
+ * columns of the same types as the recorded relation, and TIDs in the
+ * recording are only meaningful if the target has the same physical
+ * contents as the recorded relation had when the recording started.
+ * Calls with TIDs that do not refer to a tuple in the target are
+ * skipped.
+ *
+ * Indexes are not maintained by the table access method, so the
+ * target is not allowed to have any.
+ *
+ * @returns the number of calls replayed, not counting skipped calls.
+ */
+Datum traceam_replay(PG_FUNCTION_ARGS) {
+  char *path;
+  Oid source_relid;
+  Relation target;
+  FILE *file;
+  HTAB *scans;
+  TableScanDesc tidscan;
+  HASHCTL hashctl;
+  HASH_SEQ_STATUS status;
+  ReplayScanEntry *entry;
+  TraceRecordHeader header;
+  StringInfoData payload;
+  MemoryContext replaycxt, oldcxt;
+  TupleTableSlot *slot, *values_slot;
+  TransactionId last_xid = InvalidTransactionId;
+  CommandId last_cid = InvalidCommandId;
+  int64 ncalls = 0;
+  int64 nskipped = 0;
+  static const AclMode required_modes[] = {ACL_SELECT, ACL_INSERT, ACL_UPDATE,
+                                           ACL_DELETE};
+
+  if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+    PG_RETURN_NULL();
+
+  path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  source_relid = PG_ARGISNULL(2) ? InvalidOid : PG_GETARG_OID(2);
+
+  if (!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+             errmsg("permission denied to replay record file"),
+             errdetail("Only roles with privileges of the \"%s\" role may "
+                       "replay record files.",
+                       "pg_read_server_files")));
+
+  if (trace_recording())
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("cannot replay while traceam.record_file is set")));
+
+  target = table_open(PG_GETARG_OID(1), RowExclusiveLock);
+
+  for (int i = 0; i < lengthof(required_modes); i++) {
+    AclResult aclresult = pg_class_aclcheck(
+        RelationGetRelid(target), GetUserId(), required_modes[i]);
+    if (aclresult != ACLCHECK_OK)
+      aclcheck_error(aclresult,
+                     get_relkind_objtype(target->rd_rel->relkind),
+                     RelationGetRelationName(target));
+  }
+
+  if (target->rd_tableam == NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+             errmsg("\"%s\" is not a table", RelationGetRelationName(target))));
+
+  if (RelationGetIndexList(target) != NIL)
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("cannot replay into relation \"%s\" since it has indexes",
+                    RelationGetRelationName(target)),
+             errhint("Indexes are not maintained during replay.")));
+
+  file = AllocateFile(path, PG_BINARY_R);
+  if (file == NULL)
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not open record file \"%s\": %m", path)));
+
+  memset(&hashctl, 0, sizeof(hashctl));
+  hashctl.keysize = sizeof(ReplayScanKey);
+  hashctl.entrysize = sizeof(ReplayScanEntry);
+  hashctl.hcxt = CurrentMemoryContext;
+  scans = hash_create("traceam replay scans", 64, &hashctl,
+                      HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  replaycxt = AllocSetContextCreate(CurrentMemoryContext, "traceam replay",
+                                    ALLOCSET_DEFAULT_SIZES);
+  slot = table_slot_create(target, NULL);
+  values_slot =
+      MakeSingleTupleTableSlot(RelationGetDescr(target), &TTSOpsVirtual);
+  initStringInfo(&payload);
+
+  PushCopiedSnapshot(GetActiveSnapshot());
+  UpdateActiveSnapshotCommandId();
+  tidscan = table_beginscan_tid(target, GetActiveSnapshot());
+
+  while (read_record(file, path, &header, &payload)) {
+    CHECK_FOR_INTERRUPTS();
+
+    if (OidIsValid(source_relid) && header.relid != source_relid)
+      continue;
+
+    /* Command ids restart in each transaction, so a new recorded
+     * transaction is also a new command */
+    if (record_has_cid((TraceRecordKind)header.kind)) {
+      if (last_cid != InvalidCommandId &&
+          (header.cid != last_cid || header.xid != last_xid)) {
+        CommandCounterIncrement();
+        UpdateActiveSnapshotCommandId();
+      }
+      last_xid = header.xid;
+      last_cid = header.cid;
+    }
+
+    oldcxt = MemoryContextSwitchTo(replaycxt);
+    if (replay_record(target, &header, &payload, scans, oldcxt, tidscan,
+                      slot, values_slot))
+      ++ncalls;
+    else
+      ++nskipped;
+    MemoryContextSwitchTo(oldcxt);
+    MemoryContextReset(replaycxt);
+  }
+
+  if (nskipped > 0)
+    ereport(NOTICE,
+            (errmsg_plural("skipped " INT64_FORMAT " call with a TID not "
+                           "in \"%s\"",
+                           "skipped " INT64_FORMAT " calls with TIDs not "
+                           "in \"%s\"",
+                           nskipped,
+                           nskipped,
+                           RelationGetRelationName(target))));
+
+  /* End scans that were still open when the recording stopped */
+  hash_seq_init(&status, scans);
+  while ((entry = hash_seq_search(&status)) != NULL)
+    table_endscan(entry->scan);
+  table_endscan(tidscan);
+
+  PopActiveSnapshot();
+  ExecDropSingleTupleTableSlot(slot);
+  ExecDropSingleTupleTableSlot(values_slot);
+  hash_destroy(scans);
+  MemoryContextDelete(replaycxt);
+  FreeFile(file);
+  table_close(target, NoLock);
+
+  PG_RETURN_INT64(ncalls);
+}
+
+void trace_record_init(void) {
+  DefineCustomStringVariable("traceam.record_file",
+                             "File to record table access method calls to.",
+                             "Calls are appended to the file. Relative paths "
+                             "are relative to the data directory.",
+                             &trace_record_file,
+                             "",
+                             PGC_SUSET,
+                             0,
+                             NULL,
+                             assign_record_file,
+                             NULL);
+}
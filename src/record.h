@@ -0,0 +1,65 @@
+/**
+ * Recording of table access method calls.
+ *
+ * When traceam.record_file is set, the calls made to the table access
+ * method are appended to the file, together with the arguments that
+ * are needed to replay them: TIDs, slot contents, command ids, and
+ * flags. Of the snapshots, only the kind is recorded: calls made with
+ * an MVCC snapshot are replayed with the snapshot of the replaying
+ * transaction, and calls made with one of the built-in snapshots, such
+ * as SnapshotAny or a dirty snapshot, with the same kind of snapshot.
+ *
+ * The recording is a sequence of records, each consisting of a
+ * TraceRecordHeader followed by a kind-specific payload. The format is
+ * only intended to be replayed on the same cluster, so data is stored
+ * in native byte order.
+ */
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <postgres.h>
+
+#include <access/tableam.h>
+#include <executor/tuptable.h>
+#include <storage/itemptr.h>
+#include <utils/rel.h>
+
+typedef enum TraceRecordKind {
+  TRACE_RECORD_SCAN_BEGIN = 1,
+  TRACE_RECORD_SCAN_RESCAN,
+  TRACE_RECORD_SCAN_GETNEXTSLOT,
+  TRACE_RECORD_SCAN_END,
+  TRACE_RECORD_FETCH_ROW_VERSION,
+  TRACE_RECORD_TUPLE_INSERT,
+  TRACE_RECORD_MULTI_INSERT,
+  TRACE_RECORD_TUPLE_DELETE,
+  TRACE_RECORD_TUPLE_UPDATE,
+  TRACE_RECORD_TUPLE_LOCK,
+  TRACE_RECORD_SCAN_SET_TIDRANGE,
+  TRACE_RECORD_SCAN_GETNEXTSLOT_TIDRANGE,
+} TraceRecordKind;
+
+/* Pack tuple lock arguments into the record argument */
+#define TRACE_RECORD_LOCK_ARG(MODE, WAIT_POLICY, FLAGS) \
+  ((int32)(MODE) | ((int32)(WAIT_POLICY) << 8) | ((int32)(FLAGS) << 16))
+
+extern char *trace_record_file;
+
+extern void trace_record_init(void);
+extern void trace_record_scan(TraceRecordKind kind, TableScanDesc scan,
+                              int32 arg);
+extern void trace_record_scan_tidrange(TableScanDesc scan,
+                                      ItemPointer mintid, ItemPointer maxtid);
+extern void trace_record_tuple(TraceRecordKind kind, Relation relation,
+                               ItemPointer tid, CommandId cid,
+                               Snapshot snapshot, int32 arg,
+                               TupleTableSlot *slot);
+extern void trace_record_multi_insert(Relation relation,
+                                      TupleTableSlot **slots, int ntuples,
+                                      CommandId cid, int options);
+
+static inline bool trace_recording(void) {
+  return trace_record_file != NULL && trace_record_file[0] != '\0';
+}
+
+#endif /* RECORD_H_ */
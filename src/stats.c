@@ -0,0 +1,481 @@
+#include "stats.h"
+
+#include <postgres.h>
+
+#include <executor/executor.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <lib/stringinfo.h>
+#include <nodes/execnodes.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/parsenodes.h>
+#include <tcop/utility.h>
+#include <utils/builtins.h>
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/tuplestore.h>
+
+#include "trace.h"
+#include "traceam.h"
+#include "tuple.h"
+
+PG_FUNCTION_INFO_V1(traceam_callback_memory);
+PG_FUNCTION_INFO_V1(traceam_callback_memory_reset);
+
+typedef struct TraceRelationStats {
+  Oid relid;
+  TraceCallStats stats;
+} TraceRelationStats;
+
+/* Memory allocated in the caller's memory context by each callback
+ * for this backend. */
+typedef struct TraceMemoryStats {
+  uint64 calls;
+  uint64 bytes;
+  uint64 max_bytes;
+} TraceMemoryStats;
+
+static const char *const callback_names[TRACE_CALLBACK_COUNT] = {
+    [TRACE_CALLBACK_SCAN_BEGIN] = "scan_begin",
+    [TRACE_CALLBACK_SCAN_END] = "scan_end",
+    [TRACE_CALLBACK_SCAN_RESCAN] = "scan_rescan",
+    [TRACE_CALLBACK_SCAN_GETNEXTSLOT] = "getnextslot",
+    [TRACE_CALLBACK_SCAN_GETNEXTSLOT_TIDRANGE] = "getnextslot_tidrange",
+    [TRACE_CALLBACK_FETCH_ROW_VERSION] = "fetch_row_version",
+    [TRACE_CALLBACK_TUPLE_LOCK] = "tuple_lock",
+    [TRACE_CALLBACK_TUPLE_INSERT] = "tuple_insert",
+    [TRACE_CALLBACK_MULTI_INSERT] = "multi_insert",
+    [TRACE_CALLBACK_TUPLE_UPDATE] = "tuple_update",
+    [TRACE_CALLBACK_TUPLE_DELETE] = "tuple_delete",
+    [TRACE_CALLBACK_INDEX_DELETE_TUPLES] = "index_delete_tuples",
+};
+
+/* Same set of levels as auto_explain.log_level */
+static const struct config_enum_entry stats_level_options[] = {
+    {"debug5", DEBUG5, false},   {"debug4", DEBUG4, false},
+    {"debug3", DEBUG3, false},   {"debug2", DEBUG2, false},
+    {"debug1", DEBUG1, false},   {"debug", DEBUG2, true},
+    {"info", INFO, false},       {"notice", NOTICE, false},
+    {"warning", WARNING, false}, {"log", LOG, false},
+    {NULL, 0, false}};
+
+bool trace_callback_stats = false;
+bool trace_track_memory = false;
+double trace_log_min_duration = -1;
+static int trace_callback_stats_level = LOG;
+
+static TraceMemoryStats memory_stats[TRACE_CALLBACK_COUNT];
+
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+static ProcessUtility_hook_type prev_ProcessUtility = NULL;
+
+/* Executor nesting level, tracked the same way as auto_explain does,
+ * so that callbacks made by nested queries are attributed to the
+ * top-level query. */
+static int nesting_level = 0;
+
+/* Per-relation statistics for callbacks that do not have a scan
+ * descriptor. Reset at the start of each top-level query. */
+static MemoryContext relation_stats_context = NULL;
+static List *relation_stats = NIL;
+
+/**
+ * Log a callback that took longer than traceam.log_min_duration.
+ *
+ * This emits the same details as TRACE_DETAIL, but only for the slow
+ * calls. PostgreSQL does not provide a way to observe the wait events
+ * of a backend as they happen, so the buffer usage during the call is
+ * reported instead. A call that read buffers was slowed down by I/O,
+ * while a slow call without reads was typically waiting on a lock.
+ */
+static void log_slow_call(TraceCall *call, instr_time duration) {
+  BufferUsage bufusage;
+  MemoryContext oldcxt;
+
+  memset(&bufusage, 0, sizeof(bufusage));
+  BufferUsageAccumDiff(&bufusage, &pgBufferUsage, &call->bufusage_start);
+
+  oldcxt = MemoryContextSwitchTo(TraceMemoryContext());
+  ereport(LOG,
+          (errmsg("TraceAM: slow %s on %s: %.3f ms",
+                  callback_names[call->callback],
+                  RelationGetRelationName(call->relation),
+                  INSTR_TIME_GET_MILLISEC(duration)),
+           errdetail_internal(
+               "tid: %s, buffers: shared hit=" INT64_FORMAT
+               " read=" INT64_FORMAT " dirtied=" INT64_FORMAT
+               " written=" INT64_FORMAT ", I/O read time: %.3f ms, slot: %s",
+               call->tid ? itemPointerToString(call->tid) : "<>",
+               bufusage.shared_blks_hit,
+               bufusage.shared_blks_read,
+               bufusage.shared_blks_dirtied,
+               bufusage.shared_blks_written,
+               INSTR_TIME_GET_MILLISEC(bufusage.blk_read_time),
+               call->slot ? slotToString(call->slot) : "<>"),
+           errbacktrace()));
+  MemoryContextSwitchTo(oldcxt);
+  MemoryContextReset(TraceMemoryContext());
+}
+
+void trace_call_end(TraceCall *call, TraceCallStats *stats) {
+  if (call->context) {
+    TraceMemoryStats *mem = &memory_stats[call->callback];
+    Size allocated = MemoryContextMemAllocated(call->context, true);
+    uint64 bytes =
+        allocated > call->mem_start ? allocated - call->mem_start : 0;
+
+    mem->calls++;
+    mem->bytes += bytes;
+    if (bytes > mem->max_bytes)
+      mem->max_bytes = bytes;
+  }
+
+  if (call->counted || call->logged) {
+    instr_time duration;
+
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, call->start);
+
+    if (call->counted && stats) {
+      stats->calls[call->callback]++;
+      INSTR_TIME_ADD(stats->time[call->callback], duration);
+    }
+
+    if (call->logged &&
+        INSTR_TIME_GET_MILLISEC(duration) >= trace_log_min_duration)
+      log_slow_call(call, duration);
+  }
+}
+
+void trace_call_end_relation(TraceCall *call, Relation relation) {
+  TraceRelationStats *entry = NULL;
+  ListCell *lc;
+
+  if (!call->counted) {
+    trace_call_end(call, NULL);
+    return;
+  }
+
+  foreach (lc, relation_stats) {
+    TraceRelationStats *candidate = lfirst(lc);
+    if (candidate->relid == RelationGetRelid(relation)) {
+      entry = candidate;
+      break;
+    }
+  }
+
+  if (entry == NULL) {
+    MemoryContext oldcxt;
+
+    if (relation_stats_context == NULL)
+      relation_stats_context = AllocSetContextCreate(
+          TopMemoryContext, "traceam relation stats", ALLOCSET_SMALL_SIZES);
+
+    oldcxt = MemoryContextSwitchTo(relation_stats_context);
+    entry = palloc0(sizeof(TraceRelationStats));
+    entry->relid = RelationGetRelid(relation);
+    relation_stats = lappend(relation_stats, entry);
+    MemoryContextSwitchTo(oldcxt);
+  }
+
+  trace_call_end(call, &entry->stats);
+}
+
+/**
+ * Format the callback counters.
+ *
+ * Only callbacks that were actually called are included.
+ *
+ * @returns false if there were no calls at all.
+ */
+static bool format_stats(StringInfo str, TraceCallStats *stats) {
+  bool any = false;
+
+  for (int i = 0; i < TRACE_CALLBACK_COUNT; i++) {
+    if (stats->calls[i] == 0)
+      continue;
+    appendStringInfo(str, "%s%s=" UINT64_FORMAT " (%.3f ms)",
+                     any ? " " : "",
+                     callback_names[i],
+                     stats->calls[i],
+                     INSTR_TIME_GET_MILLISEC(stats->time[i]));
+    any = true;
+  }
+  return any;
+}
+
+static void report_stats(const char *what, TraceCallStats *stats,
+                         uint64 queryId) {
+  StringInfoData str;
+
+  initStringInfo(&str);
+  if (format_stats(&str, stats))
+    ereport(trace_callback_stats_level,
+            (errmsg("TraceAM: %s: %s", what, str.data),
+             queryId != 0 ? errdetail("Query identifier: " INT64_FORMAT,
+                                      (int64)queryId)
+                          : 0,
+             errhidestmt(true)));
+  pfree(str.data);
+}
+
+static const char *scan_node_name(PlanState *planstate) {
+  switch (nodeTag(planstate)) {
+    case T_SeqScanState:
+      return "Seq Scan";
+    case T_SampleScanState:
+      return "Sample Scan";
+    case T_BitmapHeapScanState:
+      return "Bitmap Heap Scan";
+    case T_TidRangeScanState:
+      return "Tid Range Scan";
+    default:
+      return NULL;
+  }
+}
+
+/* Report the counters of every scan node that uses a trace table scan
+ * descriptor. */
+static bool report_scan_walker(PlanState *planstate, void *context) {
+  QueryDesc *queryDesc = (QueryDesc *)context;
+  const char *name = scan_node_name(planstate);
+
+  if (name) {
+    TableScanDesc scan = ((ScanState *)planstate)->ss_currentScanDesc;
+    if (scan && trace_is_trace_relation(scan->rs_rd)) {
+      char *what = psprintf("%s on %s (node %d)",
+                            name,
+                            RelationGetRelationName(scan->rs_rd),
+                            planstate->plan->plan_node_id);
+      report_stats(what,
+                   &((TraceScanDesc)scan)->stats,
+                   queryDesc->plannedstmt->queryId);
+      pfree(what);
+    }
+  }
+
+  return planstate_tree_walker(planstate, report_scan_walker, context);
+}
+
+static void report_relation_stats(uint64 queryId) {
+  ListCell *lc;
+
+  foreach (lc, relation_stats) {
+    TraceRelationStats *entry = lfirst(lc);
+    char *relname = get_rel_name(entry->relid);
+    report_stats(relname ? relname : psprintf("%u", entry->relid),
+                 &entry->stats,
+                 queryId);
+  }
+}
+
+static void reset_relation_stats(void) {
+  relation_stats = NIL;
+  if (relation_stats_context)
+    MemoryContextReset(relation_stats_context);
+}
+
+static void trace_ExecutorStart(QueryDesc *queryDesc, int eflags) {
+  if (nesting_level == 0)
+    reset_relation_stats();
+
+  if (prev_ExecutorStart)
+    prev_ExecutorStart(queryDesc, eflags);
+  else
+    standard_ExecutorStart(queryDesc, eflags);
+}
+
+static void trace_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+                              uint64 count, bool execute_once) {
+  nesting_level++;
+  PG_TRY();
+  {
+    if (prev_ExecutorRun)
+      prev_ExecutorRun(queryDesc, direction, count, execute_once);
+    else
+      standard_ExecutorRun(queryDesc, direction, count, execute_once);
+  }
+  PG_FINALLY();
+  {
+    nesting_level--;
+  }
+  PG_END_TRY();
+}
+
+static void trace_ExecutorFinish(QueryDesc *queryDesc) {
+  nesting_level++;
+  PG_TRY();
+  {
+    if (prev_ExecutorFinish)
+      prev_ExecutorFinish(queryDesc);
+    else
+      standard_ExecutorFinish(queryDesc);
+  }
+  PG_FINALLY();
+  {
+    nesting_level--;
+  }
+  PG_END_TRY();
+}
+
+/* Scan descriptors are released by the standard executor end, so the
+ * counters have to be reported before calling it. */
+static void trace_ExecutorEnd(QueryDesc *queryDesc) {
+  if (trace_callback_stats && nesting_level == 0 &&
+      (queryDesc->estate->es_top_eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0) {
+    report_scan_walker(queryDesc->planstate, queryDesc);
+    report_relation_stats(queryDesc->plannedstmt->queryId);
+    reset_relation_stats();
+  }
+
+  if (prev_ExecutorEnd)
+    prev_ExecutorEnd(queryDesc);
+  else
+    standard_ExecutorEnd(queryDesc);
+}
+
+/**
+ * Return the memory allocated by each callback in this backend.
+ *
+ * Memory is counted in blocks allocated in the memory context of the
+ * caller and its children while the callback ran, so small
+ * allocations that fit in an existing block are not visible.
+ */
+Datum traceam_callback_memory(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  for (int i = 0; i < TRACE_CALLBACK_COUNT; i++) {
+    Datum values[4];
+    bool nulls[4] = {false};
+
+    if (memory_stats[i].calls == 0)
+      continue;
+
+    values[0] = CStringGetTextDatum(callback_names[i]);
+    values[1] = Int64GetDatum(memory_stats[i].calls);
+    values[2] = Int64GetDatum(memory_stats[i].bytes);
+    values[3] = Int64GetDatum(memory_stats[i].max_bytes);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+Datum traceam_callback_memory_reset(PG_FUNCTION_ARGS) {
+  memset(memory_stats, 0, sizeof(memory_stats));
+  PG_RETURN_VOID();
+}
+
+/* COPY FROM inserts using table_multi_insert() without going through
+ * the executor hooks, so the relation counters are reported here
+ * instead. The nesting level is raised while copying so that queries
+ * run by, e.g., default expressions do not reset the counters. */
+static void trace_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+                                 bool readOnlyTree,
+                                 ProcessUtilityContext context,
+                                 ParamListInfo params,
+                                 QueryEnvironment *queryEnv,
+                                 DestReceiver *dest, QueryCompletion *qc) {
+  Node *parsetree = pstmt->utilityStmt;
+  bool report = nesting_level == 0 && IsA(parsetree, CopyStmt) &&
+                ((CopyStmt *)parsetree)->is_from;
+
+  if (report) {
+    reset_relation_stats();
+    nesting_level++;
+  }
+
+  PG_TRY();
+  {
+    if (prev_ProcessUtility)
+      prev_ProcessUtility(pstmt, queryString, readOnlyTree, context, params,
+                          queryEnv, dest, qc);
+    else
+      standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+                              params, queryEnv, dest, qc);
+  }
+  PG_FINALLY();
+  {
+    if (report)
+      nesting_level--;
+  }
+  PG_END_TRY();
+
+  if (report && trace_callback_stats) {
+    report_relation_stats(pstmt->queryId);
+    reset_relation_stats();
+  }
+}
+
+void trace_stats_init(void) {
+  DefineCustomBoolVariable("traceam.callback_stats",
+                           "Count and time calls to table access method "
+                           "callbacks and report them at the end of each "
+                           "query.",
+                           NULL,
+                           &trace_callback_stats,
+                           false,
+                           PGC_USERSET,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+
+  DefineCustomEnumVariable("traceam.callback_stats_level",
+                           "Message level used to report callback "
+                           "statistics.",
+                           "Valid values are DEBUG5, DEBUG4, DEBUG3, DEBUG2, "
+                           "DEBUG1, INFO, NOTICE, WARNING, and LOG.",
+                           &trace_callback_stats_level,
+                           LOG,
+                           stats_level_options,
+                           PGC_USERSET,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+
+  DefineCustomRealVariable("traceam.log_min_duration",
+                           "Sets the minimum execution time above which "
+                           "table access method callbacks will be logged.",
+                           "Zero logs all callbacks. -1 turns this feature "
+                           "off.",
+                           &trace_log_min_duration,
+                           -1,
+                           -1,
+                           INT_MAX,
+                           PGC_SUSET,
+                           GUC_UNIT_MS,
+                           NULL,
+                           NULL,
+                           NULL);
+
+  DefineCustomBoolVariable("traceam.track_memory",
+                           "Track memory allocated in the caller's memory "
+                           "context by table access method callbacks.",
+                           NULL,
+                           &trace_track_memory,
+                           false,
+                           PGC_USERSET,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+
+  prev_ExecutorStart = ExecutorStart_hook;
+  ExecutorStart_hook = trace_ExecutorStart;
+  prev_ExecutorRun = ExecutorRun_hook;
+  ExecutorRun_hook = trace_ExecutorRun;
+  prev_ExecutorFinish = ExecutorFinish_hook;
+  ExecutorFinish_hook = trace_ExecutorFinish;
+  prev_ExecutorEnd = ExecutorEnd_hook;
+  ExecutorEnd_hook = trace_ExecutorEnd;
+  prev_ProcessUtility = ProcessUtility_hook;
+  ProcessUtility_hook = trace_ProcessUtility;
+}
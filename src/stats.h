@@ -0,0 +1,98 @@
+/**
+ * Callback statistics.
+ *
+ * Counters of the number of calls made to the table access method
+ * callbacks and the time spent in them. Scan callbacks are attributed
+ * to the scan descriptor, and hence to the plan node that owns it,
+ * while other callbacks are attributed to the relation they were
+ * called for.
+ *
+ * Starting and ending a scan is not counted in the query report, since
+ * the top-level scans end after the statistics have been reported, so
+ * they would be counted inconsistently. They are tracked for memory and
+ * slow-call logging.
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <postgres.h>
+
+#include <executor/instrument.h>
+#include <executor/tuptable.h>
+#include <portability/instr_time.h>
+#include <storage/itemptr.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+
+typedef enum TraceCallback {
+  TRACE_CALLBACK_SCAN_BEGIN, /* not in the query report */
+  TRACE_CALLBACK_SCAN_END,   /* not in the query report */
+  TRACE_CALLBACK_SCAN_RESCAN,
+  TRACE_CALLBACK_SCAN_GETNEXTSLOT,
+  TRACE_CALLBACK_SCAN_GETNEXTSLOT_TIDRANGE,
+  TRACE_CALLBACK_FETCH_ROW_VERSION,
+  TRACE_CALLBACK_TUPLE_LOCK,
+  TRACE_CALLBACK_TUPLE_INSERT,
+  TRACE_CALLBACK_MULTI_INSERT,
+  TRACE_CALLBACK_TUPLE_UPDATE,
+  TRACE_CALLBACK_TUPLE_DELETE,
+  TRACE_CALLBACK_INDEX_DELETE_TUPLES,
+  TRACE_CALLBACK_COUNT
+} TraceCallback;
+
+typedef struct TraceCallStats {
+  uint64 calls[TRACE_CALLBACK_COUNT];
+  instr_time time[TRACE_CALLBACK_COUNT];
+} TraceCallStats;
+
+/* State for a single callback invocation, kept on the stack of the
+ * callback between trace_call_begin() and trace_call_end().
+ *
+ * The relation, TID, and slot are only used to describe slow calls, so
+ * tid and slot can be NULL if the callback does not have them.
+ *
+ * If memory is tracked, context is the memory context of the caller
+ * and mem_start the number of bytes allocated in it (including
+ * children) when the callback started. */
+typedef struct TraceCall {
+  TraceCallback callback;
+  Relation relation;
+  ItemPointer tid;
+  TupleTableSlot *slot;
+  bool counted; /* add to the callback statistics */
+  bool logged;  /* log if slower than traceam.log_min_duration */
+  instr_time start;
+  BufferUsage bufusage_start;
+  MemoryContext context;
+  Size mem_start;
+} TraceCall;
+
+extern bool trace_callback_stats;
+extern bool trace_track_memory;
+extern double trace_log_min_duration;
+
+extern void trace_stats_init(void);
+extern void trace_call_end(TraceCall *call, TraceCallStats *stats);
+extern void trace_call_end_relation(TraceCall *call, Relation relation);
+
+static inline void trace_call_begin(TraceCall *call, TraceCallback callback,
+                                    Relation relation, ItemPointer tid,
+                                    TupleTableSlot *slot) {
+  call->callback = callback;
+  call->relation = relation;
+  call->tid = tid;
+  call->slot = slot;
+  call->counted = trace_callback_stats;
+  call->logged = trace_log_min_duration >= 0;
+  call->context = NULL;
+  if (call->counted || call->logged)
+    INSTR_TIME_SET_CURRENT(call->start);
+  if (call->logged)
+    call->bufusage_start = pgBufferUsage;
+  if (trace_track_memory) {
+    call->context = CurrentMemoryContext;
+    call->mem_start = MemoryContextMemAllocated(call->context, true);
+  }
+}
+
+#endif /* STATS_H_ */
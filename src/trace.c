@@ -0,0 +1,29 @@
+#include "trace.h"
+
+#include <postgres.h>
+
+#include <utils/memutils.h>
+
+static MemoryContext trace_memory_context = NULL;
+
+/**
+ * Get the memory context used to format traces.
+ *
+ * The context is created on first use and lives for the duration of the
+ * backend. It is reset after each trace, so it never holds more than
+ * what is needed to format a single message.
+ */
+MemoryContext TraceMemoryContext(void) {
+  if (trace_memory_context == NULL)
+    trace_memory_context = AllocSetContextCreate(
+        TopMemoryContext, "traceam trace formatting", ALLOCSET_DEFAULT_SIZES);
+  return trace_memory_context;
+}
+
+/* Only used inside traces, so the string is allocated in the trace
+ * memory context and released together with the message. */
+const char *itemPointerToString(ItemPointer pointer) {
+  return psprintf("%u/%u",
+                  ItemPointerGetBlockNumber(pointer),
+                  ItemPointerGetOffsetNumber(pointer));
+}
@@ -3,18 +3,39 @@
  *
  * These are used by the callbacks to emit a trace prefixed with the
  * function that is being called.
+ *
+ * The message arguments are only evaluated if the message will actually
+ * be emitted, and are evaluated in the trace memory context, which is
+ * reset once the message has been emitted, so that strings built for
+ * the trace (e.g., by slotToString) do not accumulate in the memory
+ * context of the caller.
  */
 #ifndef TRACE_H_
 #define TRACE_H_
 
-#define TRACE(FMT, ...) \
-  ereport(              \
-      DEBUG2,           \
-      (errmsg_internal("%s " FMT, __func__, ##__VA_ARGS__), errbacktrace()));
+#include <postgres.h>
+
+#include <storage/itemptr.h>
+#include <utils/memutils.h>
+
+extern MemoryContext TraceMemoryContext(void);
+extern const char *itemPointerToString(ItemPointer pointer);
+
+#define TRACE_AT(LEVEL, FMT, ...)                                        \
+  do {                                                                   \
+    if (message_level_is_interesting(LEVEL)) {                           \
+      MemoryContext trace_oldcxt_ =                                      \
+          MemoryContextSwitchTo(TraceMemoryContext());                   \
+      ereport(LEVEL,                                                     \
+              (errmsg_internal("%s " FMT, __func__, ##__VA_ARGS__),      \
+               errbacktrace()));                                         \
+      MemoryContextSwitchTo(trace_oldcxt_);                              \
+      MemoryContextReset(TraceMemoryContext());                          \
+    }                                                                    \
+  } while (0)
+
+#define TRACE(FMT, ...) TRACE_AT(DEBUG2, FMT, ##__VA_ARGS__)
 
-#define TRACE_DETAIL(FMT, ...) \
-  ereport(                     \
-      DEBUG3,                  \
-      (errmsg_internal("%s " FMT, __func__, ##__VA_ARGS__), errbacktrace()));
+#define TRACE_DETAIL(FMT, ...) TRACE_AT(DEBUG3, FMT, ##__VA_ARGS__)
 
 #endif /* TRACE_H_ */
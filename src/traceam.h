@@ -5,11 +5,15 @@
 
 #include <access/tableam.h>
 
+#include "stats.h"
+
 #define TRACEAM_SCHEMA_NAME "traceam"
 
 typedef struct TraceScanDescData {
   TableScanDescData rs_base;
   TableScanDesc guts_scan;
+  TraceCallStats stats;
+  uint32 record_scanid; /* scan number in the call recording */
 } TraceScanDescData;
 
 typedef struct TraceScanDescData* TraceScanDesc;
@@ -25,6 +29,7 @@ typedef struct TraceScanDescData* TraceScanDesc;
 # define spcOid         spcNode
 # define dbOid          dbNode
 # define relNumber      relNode
+# define rd_newRelfilelocatorSubid rd_newRelfilenodeSubid
 
 # define relation_set_new_filelocator relation_set_new_filenode
 #endif
@@ -33,5 +38,6 @@ void trace_create_filenode(Relation relation, const RelFileLocator* newrlocator,
                            char persistance);
 Relation trace_open_filenode(Oid relfilenode, LOCKMODE lockmode);
 void trace_close(Relation relation, LOCKMODE lockmode);
+bool trace_is_trace_relation(Relation relation);
 
 #endif /* TRACEAM_H_ */
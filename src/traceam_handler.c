@@ -11,9 +11,12 @@
 #include <commands/vacuum.h>
 #include <executor/tuptable.h>
 #include <miscadmin.h>
+#include <utils/guc.h>
 #include <utils/rel.h>
 #include <utils/syscache.h>
 
+#include "record.h"
+#include "stats.h"
 #include "trace.h"
 #include "traceam.h"
 #include "tuple.h"
@@ -32,15 +35,6 @@ static const TableAmRoutine traceam_methods;
    works if the calls are in the right order. */
 static Relation open_relation;
 
-static const char *itemPointerToString(ItemPointer pointer) {
-  static char buf[32];
-  sprintf(buf,
-          "%u/%u",
-          ItemPointerGetBlockNumber(pointer),
-          ItemPointerGetOffsetNumber(pointer));
-  return buf;
-}
-
 static const TupleTableSlotOps *traceam_slot_callbacks(Relation relation) {
   Relation guts;
   const TupleTableSlotOps *callbacks;
@@ -75,14 +69,16 @@ static TableScanDesc traceam_scan_begin(Relation relation, Snapshot snapshot,
                                         uint32 flags) {
   Relation guts;
   TraceScanDesc scan;
+  TraceCall call;
 
   TRACE("relation: %s, nkeys: %d, flags: %x",
         RelationGetRelationName(relation),
         nkeys,
         flags);
+  trace_call_begin(&call, TRACE_CALLBACK_SCAN_BEGIN, relation, NULL, NULL);
   RelationIncrementReferenceCount(relation);
 
-  scan = (TraceScanDesc)palloc(sizeof(TraceScanDescData));
+  scan = (TraceScanDesc)palloc0(sizeof(TraceScanDescData));
   scan->rs_base.rs_rd = relation;
   scan->rs_base.rs_snapshot = snapshot;
   scan->rs_base.rs_nkeys = nkeys;
@@ -92,40 +88,103 @@ static TableScanDesc traceam_scan_begin(Relation relation, Snapshot snapshot,
   guts = trace_open_filenode(relation->rd_rel->relfilenode, AccessShareLock);
   scan->guts_scan = guts->rd_tableam->scan_begin(
       guts, snapshot, nkeys, key, parallel_scan, flags);
+  trace_call_end(&call, NULL);
+  if (trace_recording())
+    trace_record_scan(TRACE_RECORD_SCAN_BEGIN, &scan->rs_base, flags);
   return (TableScanDesc)scan;
 }
 
 static void traceam_scan_end(TableScanDesc sscan) {
   TraceScanDesc scan = (TraceScanDesc)sscan;
-  TRACE("relation: %s", RelationGetRelationName(sscan->rs_rd));
-  RelationDecrementReferenceCount(scan->rs_base.rs_rd);
-  table_close(scan->guts_scan->rs_rd, AccessShareLock);
+  Relation relation = scan->rs_base.rs_rd;
+  Relation guts = scan->guts_scan->rs_rd;
+  TraceCall call;
+  TRACE("relation: %s", RelationGetRelationName(relation));
+  if (trace_recording())
+    trace_record_scan(TRACE_RECORD_SCAN_END, sscan, 0);
+  trace_call_begin(&call, TRACE_CALLBACK_SCAN_END, relation, NULL, NULL);
   table_endscan(scan->guts_scan);
+  table_close(guts, AccessShareLock);
+  pfree(scan);
+  trace_call_end(&call, NULL);
+  RelationDecrementReferenceCount(relation);
 }
 
 static void traceam_scan_rescan(TableScanDesc sscan, ScanKey key,
                                 bool set_params, bool allow_strat,
                                 bool allow_sync, bool allow_pagemode) {
   TraceScanDesc scan = (TraceScanDesc)sscan;
+  TraceCall call;
   TRACE("relation: %s", RelationGetRelationName(sscan->rs_rd));
+  trace_call_begin(
+      &call, TRACE_CALLBACK_SCAN_RESCAN, sscan->rs_rd, NULL, NULL);
   scan->guts_scan->rs_rd->rd_tableam->scan_rescan(scan->guts_scan,
                                                   key,
                                                   set_params,
                                                   allow_strat,
                                                   allow_sync,
                                                   allow_pagemode);
+  trace_call_end(&call, &scan->stats);
+  if (trace_recording())
+    trace_record_scan(TRACE_RECORD_SCAN_RESCAN, sscan, 0);
 }
 
 static bool traceam_scan_getnextslot(TableScanDesc sscan,
                                      ScanDirection direction,
                                      TupleTableSlot *slot) {
   TraceScanDesc scan = (TraceScanDesc)sscan;
+  TraceCall call;
+  bool result;
   TRACE("relation: %s", RelationGetRelationName(sscan->rs_rd));
   TRACE_DETAIL("slot: %s", slotToString(slot));
   /* We are storing the data in the slot for the outer table, not the
    * inner table. We probably need to use the slot for the inner table
    * and then copy the columns to the outer table slot. */
-  return table_scan_getnextslot(scan->guts_scan, direction, slot);
+  trace_call_begin(
+      &call, TRACE_CALLBACK_SCAN_GETNEXTSLOT, sscan->rs_rd, NULL, slot);
+  result = table_scan_getnextslot(scan->guts_scan, direction, slot);
+  trace_call_end(&call, &scan->stats);
+  if (trace_recording())
+    trace_record_scan(TRACE_RECORD_SCAN_GETNEXTSLOT, sscan, direction);
+  /* The inner scan sets the table of the inner relation, but the
+   * executor (e.g., for WHERE CURRENT OF) expects the traced one. */
+  slot->tts_tableOid = RelationGetRelid(sscan->rs_rd);
+  return result;
+}
+
+static void traceam_scan_set_tidrange(TableScanDesc sscan,
+                                      ItemPointer mintid,
+                                      ItemPointer maxtid) {
+  TraceScanDesc scan = (TraceScanDesc)sscan;
+  TRACE("relation: %s, mintid: %s, maxtid: %s",
+        RelationGetRelationName(sscan->rs_rd),
+        itemPointerToString(mintid),
+        itemPointerToString(maxtid));
+  table_set_tidrange(scan->guts_scan, mintid, maxtid);
+  if (trace_recording())
+    trace_record_scan_tidrange(sscan, mintid, maxtid);
+}
+
+static bool traceam_scan_getnextslot_tidrange(TableScanDesc sscan,
+                                              ScanDirection direction,
+                                              TupleTableSlot *slot) {
+  TraceScanDesc scan = (TraceScanDesc)sscan;
+  TraceCall call;
+  bool result;
+  TRACE("relation: %s", RelationGetRelationName(sscan->rs_rd));
+  TRACE_DETAIL("slot: %s", slotToString(slot));
+  trace_call_begin(&call,
+                   TRACE_CALLBACK_SCAN_GETNEXTSLOT_TIDRANGE,
+                   sscan->rs_rd,
+                   NULL,
+                   slot);
+  result = table_scan_getnextslot_tidrange(scan->guts_scan, direction, slot);
+  trace_call_end(&call, &scan->stats);
+  if (trace_recording())
+    trace_record_scan(TRACE_RECORD_SCAN_GETNEXTSLOT_TIDRANGE, sscan,
+                      direction);
+  slot->tts_tableOid = RelationGetRelid(sscan->rs_rd);
+  return result;
 }
 
 static IndexFetchTableData *traceam_index_fetch_begin(Relation relation) {
@@ -153,48 +212,94 @@ static bool traceam_index_fetch_tuple(struct IndexFetchTableData *scan,
 static bool traceam_fetch_row_version(Relation relation, ItemPointer tid,
                                       Snapshot snapshot, TupleTableSlot *slot) {
   Relation inner;
+  TraceCall call;
   bool result;
   TRACE("relation: %s", RelationGetRelationName(relation));
   TRACE_DETAIL("slot: %s", slotToString(slot));
+  trace_call_begin(&call, TRACE_CALLBACK_FETCH_ROW_VERSION, relation, tid,
+                   slot);
   inner = trace_open_filenode(relation->rd_rel->relfilenode, AccessShareLock);
   /* XXX see notes above regarding copying slots */
   result = table_tuple_fetch_row_version(inner, tid, snapshot, slot);
+  slot->tts_tableOid = RelationGetRelid(relation);
   table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_tuple(TRACE_RECORD_FETCH_ROW_VERSION, relation, tid,
+                       InvalidCommandId, snapshot, 0, NULL);
   return result;
 }
 
-static void traceam_get_latest_tid(TableScanDesc scan, ItemPointer tid) {
-  TRACE("relation: %s", RelationGetRelationName(scan->rs_rd));
+/* The TID was already validated against the outer scan by
+ * table_tuple_get_latest_tid(), which is why the inner callback is
+ * called directly rather than through the wrapper. */
+static void traceam_get_latest_tid(TableScanDesc sscan, ItemPointer tid) {
+  TraceScanDesc scan = (TraceScanDesc)sscan;
+  TableScanDesc guts_scan = scan->guts_scan;
+  TRACE("relation: %s, tid: %s",
+        RelationGetRelationName(sscan->rs_rd),
+        itemPointerToString(tid));
+  guts_scan->rs_rd->rd_tableam->tuple_get_latest_tid(guts_scan, tid);
 }
 
-static bool traceam_tuple_tid_valid(TableScanDesc scan, ItemPointer tid) {
-  TRACE("relation: %s", RelationGetRelationName(scan->rs_rd));
-  return false;
+static bool traceam_tuple_tid_valid(TableScanDesc sscan, ItemPointer tid) {
+  TraceScanDesc scan = (TraceScanDesc)sscan;
+  TRACE("relation: %s, tid: %s",
+        RelationGetRelationName(sscan->rs_rd),
+        itemPointerToString(tid));
+  return table_tuple_tid_valid(scan->guts_scan, tid);
 }
 
 static bool traceam_tuple_satisfies_snapshot(Relation relation,
                                              TupleTableSlot *slot,
                                              Snapshot snapshot) {
+  Relation inner;
+  bool result;
   TRACE("relation: %s", RelationGetRelationName(relation));
   TRACE_DETAIL("slot: %s", slotToString(slot));
-  return false;
+  inner = trace_open_filenode(relation->rd_rel->relfilenode, AccessShareLock);
+  result = table_tuple_satisfies_snapshot(inner, slot, snapshot);
+  table_close(inner, NoLock);
+  return result;
 }
 
+/* Index entries point to tuples in the inner heap, so it is the inner
+ * heap that decides which entries are dead and computes the conflict
+ * horizon for them. */
 static TransactionId traceam_index_delete_tuples(Relation relation,
                                                  TM_IndexDeleteOp *delstate) {
-  TRACE("relation: %s", RelationGetRelationName(relation));
-  return InvalidTransactionId;
+  Relation inner;
+  TraceCall call;
+  TransactionId result;
+  TRACE("relation: %s, bottomup: %s, ndeltids: %d",
+        RelationGetRelationName(relation),
+        delstate->bottomup ? "true" : "false",
+        delstate->ndeltids);
+  trace_call_begin(&call, TRACE_CALLBACK_INDEX_DELETE_TUPLES, relation, NULL,
+                   NULL);
+  inner = trace_open_filenode(relation->rd_rel->relfilenode, AccessShareLock);
+  result = table_index_delete_tuples(inner, delstate);
+  table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  return result;
 }
 
 static void traceam_tuple_insert(Relation relation, TupleTableSlot *slot,
                                  CommandId cid, int options,
                                  BulkInsertState bistate) {
   Relation guts;
+  TraceCall call;
   TRACE("relation: %s, cid: %d", RelationGetRelationName(relation), cid);
   TRACE_DETAIL("slot: %s", slotToString(slot));
+  trace_call_begin(&call, TRACE_CALLBACK_TUPLE_INSERT, relation, NULL, slot);
   guts = trace_open_filenode(relation->rd_rel->relfilenode, RowExclusiveLock);
   table_tuple_insert(guts, slot, cid, options, bistate);
+  slot->tts_tableOid = RelationGetRelid(relation);
   table_close(guts, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_tuple(TRACE_RECORD_TUPLE_INSERT, relation, NULL, cid, NULL,
+                       options, slot);
 }
 
 static void traceam_tuple_insert_speculative(Relation relation,
@@ -208,6 +313,7 @@ static void traceam_tuple_insert_speculative(Relation relation,
       trace_open_filenode(relation->rd_rel->relfilenode, RowExclusiveLock);
   table_tuple_insert_speculative(
       open_relation, slot, cid, options, bistate, specToken);
+  slot->tts_tableOid = RelationGetRelid(relation);
 }
 
 static void traceam_tuple_complete_speculative(Relation relation,
@@ -223,13 +329,20 @@ static void traceam_multi_insert(Relation relation, TupleTableSlot **slots,
                                  int ntuples, CommandId cid, int options,
                                  BulkInsertState bistate) {
   Relation inner;
+  TraceCall call;
   TRACE("relation: %s, cid: %u, ntuples: %d",
         RelationGetRelationName(relation),
         cid,
         ntuples);
+  trace_call_begin(&call, TRACE_CALLBACK_MULTI_INSERT, relation, NULL, NULL);
   inner = trace_open_filenode(relation->rd_rel->relfilenode, RowExclusiveLock);
   table_multi_insert(inner, slots, ntuples, cid, options, bistate);
+  for (int i = 0; i < ntuples; i++)
+    slots[i]->tts_tableOid = RelationGetRelid(relation);
   table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_multi_insert(relation, slots, ntuples, cid, options);
 }
 
 static TM_Result traceam_tuple_delete(Relation relation, ItemPointer tid,
@@ -237,12 +350,18 @@ static TM_Result traceam_tuple_delete(Relation relation, ItemPointer tid,
                                       Snapshot crosscheck, bool wait,
                                       TM_FailureData *tmfd, bool changingPart) {
   Relation inner;
+  TraceCall call;
   TM_Result result;
   TRACE("relation: %s, cid: %d", RelationGetRelationName(relation), cid);
+  trace_call_begin(&call, TRACE_CALLBACK_TUPLE_DELETE, relation, tid, NULL);
   inner = trace_open_filenode(relation->rd_rel->relfilenode, RowExclusiveLock);
   result = table_tuple_delete(inner, tid, cid, snapshot, crosscheck, wait, tmfd,
                               changingPart);
   table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_tuple(TRACE_RECORD_TUPLE_DELETE, relation, tid, cid,
+                       snapshot, 0, NULL);
   return result;
 }
 
@@ -253,13 +372,20 @@ static TM_Result traceam_tuple_update(Relation relation, ItemPointer otid,
                                       LockTupleMode *lockmode,
                                       bool *update_indexes) {
   Relation inner;
+  TraceCall call;
   TM_Result result;
   TRACE("relation: %s, cid: %d", RelationGetRelationName(relation), cid);
   TRACE_DETAIL("slot: %s", slotToString(slot));
+  trace_call_begin(&call, TRACE_CALLBACK_TUPLE_UPDATE, relation, otid, slot);
   inner = trace_open_filenode(relation->rd_rel->relfilenode, RowExclusiveLock);
   result = table_tuple_update(inner, otid, slot, cid, snapshot, crosscheck,
                               wait, tmfd, lockmode, update_indexes);
+  slot->tts_tableOid = RelationGetRelid(relation);
   table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_tuple(TRACE_RECORD_TUPLE_UPDATE, relation, otid, cid,
+                       snapshot, 0, slot);
   return result;
 }
 
@@ -269,13 +395,20 @@ static TM_Result traceam_tuple_lock(Relation relation, ItemPointer tid,
                                     LockWaitPolicy wait_policy, uint8 flags,
                                     TM_FailureData *tmfd) {
   Relation inner;
+  TraceCall call;
   TM_Result result;
   TRACE("relation: %s, cid: %d", RelationGetRelationName(relation), cid);
   TRACE_DETAIL("slot: %s", slotToString(slot));
+  trace_call_begin(&call, TRACE_CALLBACK_TUPLE_LOCK, relation, tid, slot);
   inner = trace_open_filenode(relation->rd_rel->relfilenode, AccessShareLock);
   result = table_tuple_lock(inner, tid, snapshot, slot, cid, mode, wait_policy,
                             flags, tmfd);
+  slot->tts_tableOid = RelationGetRelid(relation);
   table_close(inner, NoLock);
+  trace_call_end_relation(&call, relation);
+  if (trace_recording())
+    trace_record_tuple(TRACE_RECORD_TUPLE_LOCK, relation, tid, cid, snapshot,
+                       TRACE_RECORD_LOCK_ARG(mode, wait_policy, flags), NULL);
   return result;
 }
 
@@ -432,6 +565,9 @@ static const TableAmRoutine traceam_methods = {
     .scan_rescan = traceam_scan_rescan,
     .scan_getnextslot = traceam_scan_getnextslot,
 
+    .scan_set_tidrange = traceam_scan_set_tidrange,
+    .scan_getnextslot_tidrange = traceam_scan_getnextslot_tidrange,
+
     .parallelscan_estimate = table_block_parallelscan_estimate,
     .parallelscan_initialize = table_block_parallelscan_initialize,
     .parallelscan_reinitialize = table_block_parallelscan_reinitialize,
@@ -478,9 +614,21 @@ static const TableAmRoutine traceam_methods = {
     .scan_sample_next_tuple = traceam_scan_sample_next_tuple,
 };
 
+bool trace_is_trace_relation(Relation relation) {
+  return relation->rd_tableam == &traceam_methods;
+}
+
 Datum traceam_handler(PG_FUNCTION_ARGS) {
   PG_RETURN_POINTER(&traceam_methods);
 }
 
 void _PG_init(void) {
+  trace_stats_init();
+  trace_record_init();
+
+#if PG_MAJORVERSION_NUM >= 15
+  MarkGUCPrefixReserved("traceam");
+#else
+  EmitWarningsOnPlaceholders("traceam");
+#endif
 }
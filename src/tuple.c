@@ -8,15 +8,7 @@
 #include <lib/stringinfo.h>
 #include <nodes/memnodes.h>
 
-/**
- * Trace macro.
- *
- * This is used by the callbacks to emit a trace prefixed with the
- * function that is being called.
- */
-#define TRACE(FMT, ...) ereport(DEBUG2, \
-                                (errmsg_internal("%s " FMT, __func__, ##__VA_ARGS__), \
-                                 errbacktrace()));
+#include "trace.h"
 
 typedef struct TraceTupleTableSlot {
   TupleTableSlot base;
@@ -9,3 +9,25 @@ CREATE FUNCTION traceam_handler(internal) RETURNS table_am_handler AS '$libdir/t
 CREATE ACCESS METHOD traceam TYPE TABLE HANDLER traceam_handler;
 COMMENT ON ACCESS METHOD traceam IS 'Table access method tracing calls';
 
+
+CREATE FUNCTION traceam_callback_memory(
+    OUT callback text,
+    OUT calls bigint,
+    OUT bytes bigint,
+    OUT max_bytes bigint)
+RETURNS SETOF record AS '$libdir/traceam' LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION traceam_callback_memory_reset() RETURNS void
+AS '$libdir/traceam' LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW traceam.callback_memory AS
+  SELECT * FROM traceam_callback_memory();
+COMMENT ON VIEW traceam.callback_memory IS
+  'Memory allocated in the caller''s memory context by each callback in this backend';
+
+CREATE FUNCTION traceam_replay(path text, target regclass,
+                               source regclass DEFAULT NULL)
+RETURNS bigint AS '$libdir/traceam' LANGUAGE C VOLATILE;
+COMMENT ON FUNCTION traceam_replay(text, regclass, regclass) IS
+  'Replay table access method calls recorded using traceam.record_file';
+REVOKE ALL ON FUNCTION traceam_replay(text, regclass, regclass) FROM PUBLIC;